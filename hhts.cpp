@@ -8,7 +8,69 @@
 
 namespace HHTS
 {
-    void getChannels(InputArray image, int colorChannels, OutputArrayOfArrays outputChannels, bool applyBlur)
+    // 16-bit color conversion via float, channels rescaled to the full 16-bit range
+    void cvtColor16U(InputArray image, OutputArray output, int code, const Vec3d &scale, const Vec3d &offset)
+    {
+        Mat img;
+        Mat chs[3];
+        image.getMat().convertTo(img, CV_32F, 1.0 / 65535);
+        cvtColor(img, img, code);
+        split(img, chs);
+        for (int c = 0; c < 3; c++)
+        {
+            chs[c].convertTo(chs[c], CV_16U, scale[c], offset[c] * scale[c]);
+        }
+        merge(chs, 3, output);
+    }
+
+    // invalid depth (0) is filled with the nearest valid depth, valid range is stretched to the full 16-bit range
+    void getDepthChannel(InputArray inputDepth, OutputArray output)
+    {
+        Mat depth;
+        inputDepth.getMat().convertTo(depth, CV_32F);
+        const Mat validMask = (depth > 0);
+        const int validCount = countNonZero(validMask);
+        if (validCount == 0)
+        {
+            Mat::zeros(depth.size(), CV_16UC1).copyTo(output);
+            return;
+        }
+
+        double minVal, maxVal;
+        minMaxLoc(depth, &minVal, &maxVal, nullptr, nullptr, validMask);
+
+        // nearest valid pixel for every pixel (each valid pixel is its own label)
+        Mat distances, nearestValid;
+        distanceTransform(~validMask, distances, nearestValid, DIST_L2, DIST_MASK_5, DIST_LABEL_PIXEL);
+        vector<float> validDepths(validCount + 1, 0.0f);
+        for (int y = 0; y < depth.rows; ++y)
+        {
+            const float *depthRow = depth.ptr<float>(y);
+            const int *nearestRow = nearestValid.ptr<int>(y);
+            const uchar *validRow = validMask.ptr<uchar>(y);
+            for (int x = 0; x < depth.cols; ++x)
+            {
+                if (validRow[x] > 0)
+                {
+                    validDepths[nearestRow[x]] = depthRow[x];
+                }
+            }
+        }
+        for (int y = 0; y < depth.rows; ++y)
+        {
+            float *depthRow = depth.ptr<float>(y);
+            const int *nearestRow = nearestValid.ptr<int>(y);
+            for (int x = 0; x < depth.cols; ++x)
+            {
+                depthRow[x] = validDepths[nearestRow[x]];
+            }
+        }
+
+        const double scale = maxVal > minVal ? 65535 / (maxVal - minVal) : 0.0;
+        depth.convertTo(output, CV_16U, scale, -minVal * scale);
+    }
+
+    void getChannels(InputArray image, int colorChannels, InputArray depth, OutputArrayOfArrays outputChannels, bool applyBlur)
     {
         vector<Mat> channels;
         const int blurSize = 3;
@@ -32,7 +94,14 @@ namespace HHTS
         {
             Mat img;
             Mat chs[3];
-            cvtColor(image, img, COLOR_BGR2HSV);
+            if (image.depth() == CV_16U)
+            {
+                cvtColor16U(image, img, COLOR_BGR2HSV, Vec3d(257 * 180.0 / 360, 65535, 65535), Vec3d(0, 0, 0));
+            }
+            else
+            {
+                cvtColor(image, img, COLOR_BGR2HSV);
+            }
             if (applyBlur)
             {
                 GaussianBlur(img, img, Size(blurSize, blurSize), 0, 0);
@@ -47,7 +116,14 @@ namespace HHTS
         {
             Mat img;
             Mat chs[3];
-            cvtColor(image, img, COLOR_BGR2Lab);
+            if (image.depth() == CV_16U)
+            {
+                cvtColor16U(image, img, COLOR_BGR2Lab, Vec3d(65535.0 / 100, 257, 257), Vec3d(0, 127.5, 127.5));
+            }
+            else
+            {
+                cvtColor(image, img, COLOR_BGR2Lab);
+            }
             if (applyBlur)
             {
                 GaussianBlur(img, img, Size(blurSize, blurSize), 0, 0);
@@ -58,7 +134,20 @@ namespace HHTS
             channels.push_back(chs[2]);
         }
 
-        outputChannels.create(Size(channels.size(), 1), CV_8UC1);
+        if (!depth.empty())
+        {
+            CV_Assert(depth.size() == image.size() && depth.channels() == 1 && (depth.depth() == CV_8U || depth.depth() == CV_16U));
+            Mat img;
+            getDepthChannel(depth, img);
+            if (applyBlur)
+            {
+                GaussianBlur(img, img, Size(blurSize, blurSize), 0, 0);
+            }
+            channels.push_back(img);
+        }
+
+        // only sizes the channel vector, copyTo keeps each channel's own type (depth may differ from color)
+        outputChannels.create(Size(channels.size(), 1), CV_MAKETYPE(image.depth(), 1));
         for (int iChannel = 0; iChannel < channels.size(); iChannel++)
         {
             channels[iChannel].copyTo(outputChannels.getMatRef(iChannel));
@@ -74,8 +163,11 @@ namespace HHTS
         max = maxVal;
         width = max - min;
 
+        // 16-bit channels compete with 8-bit channels in 8-bit units
+        const double valueScale = channel.depth() == CV_16U ? 257.0 : 1.0;
+
         // prevent small channels -> auto-termination
-        if (width < 2)
+        if (width < 2 * valueScale)
         {
             splitCriteria = -1.0;
             return;
@@ -87,12 +179,19 @@ namespace HHTS
         const double mean = meanVal.val[0];
         const double stdDev = stdDevVal.val[0];
 
-        splitCriteria = stdDev * size * size;
+        splitCriteria = stdDev / valueScale * size * size;
     }
 
-    Label::Label(const InputArrayOfArrays channels, const InputArray inputMask, const int labelSize, const int id, const SplitParams &splitParams) : id(id), labelSize(labelSize)
+    Label::Label(const InputArrayOfArrays channels, const InputArray inputMask, const Point &maskOffset, const int labelSize, const int id, const SplitParams &splitParams) : id(id), labelSize(labelSize)
     {
-        mask = inputMask.getMat().clone();
+        // crop to bounding rect => split cost scales with label extent instead of image size
+        const Mat fullMask = inputMask.getMat();
+        const Rect maskRect = boundingRect(fullMask);
+        roi = maskRect + maskOffset;
+        mask = fullMask(maskRect).clone();
+
+        touchesCore = !splitParams.coreRing.empty() && countNonZero(splitParams.coreRing(roi) & mask) > 0;
+        leftoverTouchesCore = false;
 
         childMinSize = splitParams.minSegmentSize;
 
@@ -105,7 +204,7 @@ namespace HHTS
         labelSplitChannel = -1;
         for (int iChannel = 0; iChannel < channels.total(); iChannel++)
         {
-            const ChannelInfo channelInfo(channels.getMat(iChannel), mask, labelSize);
+            const ChannelInfo channelInfo(channels.getMat(iChannel)(roi), mask, labelSize);
             channelInfos.push_back(channelInfo);
             if (channelInfo.splitCriteria > labelSplitCriteria)
             {
@@ -124,6 +223,7 @@ namespace HHTS
     void getChannelThreshold(const InputArray inputChannel, const ChannelInfo &channelInfo, const InputArray mask, const SplitParams &splitParams, int &thresholdValue)
     {
         // calc hist
+        // --bins span only [min, max] of the label, so 16-bit channels cost the same as 8-bit channels
         const int channelBins = min(splitParams.histogramBins, channelInfo.width);
         const float range[] = {((float)channelInfo.min), ((float)channelInfo.max) + 1};
         const float *histRange[] = {range};
@@ -196,26 +296,24 @@ namespace HHTS
     }
 
     void Label::split(const InputArrayOfArrays channels, const InputOutputArray inputOutputLabels,
-                      const Size &size,
-                      int &nextLabel, vector<Label> &splittableLabels,
+                      int &nextLabel, int &mergedLabelCount, vector<Label> &splittableLabels,
                       const SplitParams &splitParams)
     {
         // get channel to split
-        const Mat channel = channels.getMat(labelSplitChannel);
+        const Mat channel = channels.getMat(labelSplitChannel)(roi);
 
         int thresholdValue;
         getChannelThreshold(channel, channelInfos[labelSplitChannel], mask, splitParams, thresholdValue);
 
         // threshold and spacial split for low and high
-        Mat rawFloodAreas = Mat::zeros(size, CV_8UC1);
+        Mat rawFloodAreas = Mat::zeros(roi.size(), CV_8UC1);
         vector<Point> floodSeeds{};
         Mat ccLabels, ccStats, ccCentroids;
         int ccLabelCount;
 
         // --low
         // get threshold masks
-        Mat lowMask;
-        threshold(channel, lowMask, thresholdValue, 1, THRESH_BINARY_INV);
+        Mat lowMask = (channel <= thresholdValue);
         bitwise_and(lowMask, mask, lowMask);
 
         const int CCL_Type = CCL_DEFAULT;
@@ -257,8 +355,7 @@ namespace HHTS
 
         // --high
         // get threshold masks
-        Mat highMask;
-        threshold(channel, highMask, thresholdValue, 1, THRESH_BINARY);
+        Mat highMask = (channel > thresholdValue);
         bitwise_and(highMask, mask, highMask);
 
         // spacial low high split
@@ -296,11 +393,19 @@ namespace HHTS
         {
             return interruptSplit(inputOutputLabels, splittableLabels, splitParams);
         }
+
+        // pixels not flooded by later children keep the parent id
+        Mat idMask;
+        if (!splitParams.coreRing.empty())
+        {
+            idMask = mask.clone();
+        }
         mask.release();
 
         // final flooding
         const double iterationBorderConfidence = -(nextLabel + 1);
-        Mat labels = inputOutputLabels.getMatRef();
+        Mat labels = inputOutputLabels.getMatRef()(roi);
+        vector<Label> childLabels{};
         bool floodedFirst = false;
         for (const Point &floodSeed : floodSeeds)
         {
@@ -315,37 +420,142 @@ namespace HHTS
 
             // create child label
             const int childLabelId = floodedFirst ? nextLabel++ : id; // first child takes id of parent
-            const Label childLabel(channels, floodMask, floodSize, childLabelId, splitParams);
+            const Label childLabel(channels, floodMask, roi.tl(), floodSize, childLabelId, splitParams);
 
-            // remember child label if still splittable
             if (floodedFirst)
             {
                 labels.setTo(childLabelId, floodMask);
+                if (!idMask.empty())
+                {
+                    idMask.setTo(0, floodMask);
+                }
             }
 
+            childLabels.push_back(childLabel);
+            floodedFirst = true;
+        }
+
+        // leftover pixels of this split keep the id of the first child
+        if (!splitParams.coreRing.empty())
+        {
+            Label &firstChild = childLabels[0];
+            idMask(firstChild.roi - roi.tl()).setTo(0, firstChild.mask);
+            firstChild.leftoverTouchesCore = leftoverTouchesCore || countNonZero(splitParams.coreRing(roi) & idMask) > 0;
+        }
+
+        // update label count after merging
+        mergedLabelCount -= isMergedIntoCore() ? 0 : 1;
+        for (const Label &childLabel : childLabels)
+        {
+            mergedLabelCount += childLabel.isMergedIntoCore() ? 0 : 1;
+
+            // remember child label if still splittable
             if (childLabel.isSplittable(splitParams.splitThreshold))
             {
                 splittableLabels.insert(std::lower_bound(splittableLabels.begin(), splittableLabels.end(), childLabel, Label::compare), childLabel);
             }
-            floodedFirst = true;
         }
     }
 
-    int hhts(const InputArray image, const OutputArray outputLabels, const int superpixels, const double splitThreshold, const int histogramBins, const int minSegmentSize, const int colorChannels, const bool applyBlur, const InputArray inputPreLabels)
+    void getBoundaryBand(const InputArray inputPreLabels, const int bandWidth, const OutputArray outputBand)
+    {
+        // boundary pixels have a 4-neighbour with a different pre-label
+        Mat preLabels, dilated, eroded;
+        inputPreLabels.getMat().convertTo(preLabels, CV_32F);
+        const Mat kernel = getStructuringElement(MORPH_CROSS, Size(3, 3));
+        dilate(preLabels, dilated, kernel);
+        erode(preLabels, eroded, kernel);
+        const Mat notBoundary = (dilated == eroded);
+
+        // band of all pixels within bandWidth of a boundary
+        Mat distances;
+        distanceTransform(notBoundary, distances, DIST_L2, DIST_MASK_PRECISE);
+        const Mat band = (distances <= bandWidth);
+        band.copyTo(outputBand);
+    }
+
+    // merged labels are relabeled contiguously
+    void mergeBandFragments(const InputArray inputLabels, const InputArray inputPreLabelIds, const InputArray inputBand, const InputArray inputCoreRing, const int labelCount, const OutputArray outputLabels)
+    {
+        const Mat labels = inputLabels.getMat();
+        const Mat preLabelIds = inputPreLabelIds.getMat();
+        const Mat band = inputBand.getMat();
+        const Mat coreRing = inputCoreRing.getMat();
+
+        // band labels touching the fixed interior of their pre-label are merged into it
+        vector<int> mergeIds(labelCount, 0);
+        for (int y = 0; y < labels.rows; ++y)
+        {
+            const int *labelRow = labels.ptr<int>(y);
+            const int *preLabelIdRow = preLabelIds.ptr<int>(y);
+            const uchar *coreRingRow = coreRing.ptr<uchar>(y);
+            for (int x = 0; x < labels.cols; ++x)
+            {
+                if (coreRingRow[x] > 0)
+                {
+                    mergeIds[labelRow[x]] = preLabelIdRow[x];
+                }
+            }
+        }
+
+        Mat mergedLabels = labels.clone();
+        for (int y = 0; y < mergedLabels.rows; ++y)
+        {
+            int *labelRow = mergedLabels.ptr<int>(y);
+            const uchar *bandRow = band.ptr<uchar>(y);
+            for (int x = 0; x < mergedLabels.cols; ++x)
+            {
+                if (bandRow[x] > 0 && mergeIds[labelRow[x]] > 0)
+                {
+                    labelRow[x] = mergeIds[labelRow[x]];
+                }
+            }
+        }
+
+        // relabel remaining labels contiguously (keeping their order)
+        vector<int> newIds(labelCount, 0);
+        for (int y = 0; y < mergedLabels.rows; ++y)
+        {
+            const int *labelRow = mergedLabels.ptr<int>(y);
+            for (int x = 0; x < mergedLabels.cols; ++x)
+            {
+                newIds[labelRow[x]] = 1;
+            }
+        }
+        int nextMergedLabel = 1;
+        for (int label = 1; label < labelCount; ++label)
+        {
+            if (newIds[label] > 0)
+            {
+                newIds[label] = nextMergedLabel++;
+            }
+        }
+        for (int y = 0; y < mergedLabels.rows; ++y)
+        {
+            int *labelRow = mergedLabels.ptr<int>(y);
+            for (int x = 0; x < mergedLabels.cols; ++x)
+            {
+                labelRow[x] = newIds[labelRow[x]];
+            }
+        }
+        mergedLabels.copyTo(outputLabels);
+    }
+
+    int hhts(const InputArray image, const OutputArray outputLabels, const int superpixels, const double splitThreshold, const int histogramBins, const int minSegmentSize, const int colorChannels, const bool applyBlur, const InputArray inputPreLabels, const int refineBandWidth, const InputArray depth)
     {
         vector<Mat> labels;
         const vector<int> superpixelss = {superpixels};
-        const vector<int> labelCounts = hhts(image, labels, superpixelss, splitThreshold, histogramBins, minSegmentSize, colorChannels, applyBlur, inputPreLabels);
+        const vector<int> labelCounts = hhts(image, labels, superpixelss, splitThreshold, histogramBins, minSegmentSize, colorChannels, applyBlur, inputPreLabels, refineBandWidth, depth);
         labels[0].copyTo(outputLabels.getMatRef());
         return labelCounts[0];
     }
 
-    vector<int> hhts(const InputArray image, const OutputArrayOfArrays outputLabels, const vector<int> &superpixels, const double splitThreshold, const int histogramBins, const int minSegmentSize, const int colorChannels, const bool applyBlur, const InputArray inputPreLabels)
+    vector<int> hhts(const InputArray image, const OutputArrayOfArrays outputLabels, const vector<int> &superpixels, const double splitThreshold, const int histogramBins, const int minSegmentSize, const int colorChannels, const bool applyBlur, const InputArray inputPreLabels, const int refineBandWidth, const InputArray depth)
     {
         const Size size = image.size();
 
         vector<Mat> channels;
-        getChannels(image, colorChannels, channels, applyBlur);
+        getChannels(image, colorChannels, depth, channels, applyBlur);
 
         SplitParams splitParams(superpixels, splitThreshold, histogramBins, minSegmentSize);
 
@@ -359,6 +569,24 @@ namespace HHTS
         {
             preLabels = Mat::ones(size, CV_32SC1);
         }
+
+        // boundary refinement => only split a band around pre-label boundaries
+        const bool refineBoundaries = refineBandWidth > 0 && !inputPreLabels.empty();
+        Mat band, coreRing, preLabelIds;
+        if (refineBoundaries)
+        {
+            getBoundaryBand(preLabels, refineBandWidth, band);
+
+            // band pixels adjacent to a pre-label interior
+            const Mat kernel = getStructuringElement(MORPH_CROSS, Size(3, 3));
+            dilate(band == 0, coreRing, kernel);
+            bitwise_and(coreRing, band, coreRing);
+            splitParams.coreRing = coreRing;
+
+            preLabelIds = Mat::zeros(size, CV_32SC1);
+        }
+        int mergedLabelCount = 1; // label count after merging band fragments (boundary refinement only)
+
         // init pre labels
         while (true)
         {
@@ -375,11 +603,43 @@ namespace HHTS
             const int preLabelId = nextLabel++;
             const Mat preLabelMask = preLabels == preLabelPreId;
             preLabels.setTo(0, preLabelMask);
-            const int preLabelSize = SparseMat(preLabelMask).nzcount();
-            const Label preLabel(channels, preLabelMask, preLabelSize, preLabelId, splitParams);
-
             labels.setTo(preLabelId, preLabelMask);
 
+            // interior of pre-label stays fixed during refinement
+            Mat splitMask;
+            if (refineBoundaries)
+            {
+                bitwise_and(preLabelMask, band, splitMask);
+            }
+            else
+            {
+                splitMask = preLabelMask;
+            }
+            const int preLabelSize = SparseMat(splitMask).nzcount();
+            if (refineBoundaries && countNonZero(preLabelMask) > preLabelSize)
+            {
+                // non-empty interior
+                mergedLabelCount++;
+            }
+            if (preLabelSize == 0)
+            {
+                continue;
+            }
+
+            // band gets its own label, only merged back into the interior if adjacent to it
+            int splitLabelId = preLabelId;
+            if (refineBoundaries)
+            {
+                preLabelIds.setTo(preLabelId, preLabelMask);
+                splitLabelId = nextLabel++;
+                labels.setTo(splitLabelId, splitMask);
+            }
+            const Label preLabel(channels, splitMask, Point(0, 0), preLabelSize, splitLabelId, splitParams);
+            if (refineBoundaries && !preLabel.isMergedIntoCore())
+            {
+                mergedLabelCount++;
+            }
+
             if (preLabel.isSplittable(splitParams.splitThreshold))
             {
                 splittableLabels.insert(std::lower_bound(splittableLabels.begin(), splittableLabels.end(), preLabel, Label::compare), preLabel);
@@ -394,15 +654,24 @@ namespace HHTS
             Label worstLabel = splittableLabels[0];
             splittableLabels.erase(splittableLabels.begin());
 
-            worstLabel.split(channels, labels, size, nextLabel, splittableLabels, splitParams);
+            worstLabel.split(channels, labels, nextLabel, mergedLabelCount, splittableLabels, splitParams);
 
             // check for label output
-            while (splitParams.superpixels.size() > 0 && splitParams.superpixels[0] >= 0 && nextLabel > splitParams.superpixels[0])
+            // --superpixels counts labels after merging for boundary refinement
+            const int labelCount = refineBoundaries ? mergedLabelCount : nextLabel;
+            while (splitParams.superpixels.size() > 0 && splitParams.superpixels[0] >= 0 && labelCount > splitParams.superpixels[0])
             {
                 splitParams.superpixels.erase(splitParams.superpixels.begin());
 
-                labels.copyTo(outputLabels.getMatRef(labelCounts.size()));
-                labelCounts.push_back(nextLabel);
+                if (refineBoundaries)
+                {
+                    mergeBandFragments(labels, preLabelIds, band, coreRing, nextLabel, outputLabels.getMatRef(labelCounts.size()));
+                }
+                else
+                {
+                    labels.copyTo(outputLabels.getMatRef(labelCounts.size()));
+                }
+                labelCounts.push_back(labelCount);
             }
         }
 
@@ -411,8 +680,16 @@ namespace HHTS
         {
             splitParams.superpixels.erase(splitParams.superpixels.begin());
 
-            labels.copyTo(outputLabels.getMatRef(labelCounts.size()));
-            labelCounts.push_back(nextLabel);
+            if (refineBoundaries)
+            {
+                mergeBandFragments(labels, preLabelIds, band, coreRing, nextLabel, outputLabels.getMatRef(labelCounts.size()));
+                labelCounts.push_back(mergedLabelCount);
+            }
+            else
+            {
+                labels.copyTo(outputLabels.getMatRef(labelCounts.size()));
+                labelCounts.push_back(nextLabel);
+            }
         }
 
         return labelCounts;
@@ -36,6 +36,7 @@ namespace HHTS
         double splitThreshold;
         int histogramBins;
         int minSegmentSize;
+        Mat coreRing; // band pixels adjacent to a pre-label interior (boundary refinement only)
 
     public:
         SplitParams(const vector<int> &superpixels = {}, const double splitThreshold = 0.0, const int histogramBins = 16, const int minSegmentSize = 64) : superpixels(superpixels), splitThreshold(splitThreshold), histogramBins(histogramBins), minSegmentSize(minSegmentSize) {}
@@ -52,6 +53,7 @@ namespace HHTS
     {
         int id;
 
+        Rect roi; // bounding rect of label, mask and split are cropped to it
         Mat mask;
 
         vector<ChannelInfo> channelInfos;
@@ -61,13 +63,17 @@ namespace HHTS
         int labelSize;
         int childMinSize;
 
+        // boundary refinement: label id is merged into its pre-label if any of its pixels touches the core ring
+        bool touchesCore;
+        bool leftoverTouchesCore; // pixels left over from earlier splits keep the id
+
     public:
-        Label(const InputArrayOfArrays channels, const InputArray mask, const int labelSize, const int id, const SplitParams &splitParams);
+        Label(const InputArrayOfArrays channels, const InputArray mask, const Point &maskOffset, const int labelSize, const int id, const SplitParams &splitParams);
         bool isSizeSplittable() const { return labelSize / 2 >= childMinSize; }
         bool isSplittable(const double splitThreshold) const { return labelSplitCriteria > splitThreshold && isSizeSplittable(); }
+        bool isMergedIntoCore() const { return touchesCore || leftoverTouchesCore; }
         void split(const InputArrayOfArrays channels, const InputOutputArray inputOutputLabels,
-                   const Size &size,
-                   int &nextLabel, vector<Label> &splittableLabels,
+                   int &nextLabel, int &mergedLabelCount, vector<Label> &splittableLabels,
                    const SplitParams &splitParams);
         static bool compare(const Label label0, const Label label1) { return label0.labelSplitCriteria > label1.labelSplitCriteria; }
 
@@ -76,12 +82,17 @@ namespace HHTS
     };
 
     // returns label count
+    // image may be 8-bit or 16-bit BGR, optional depth (8-bit or 16-bit, single channel) is an additional split channel,
+    // invalid depth (0) is filled with the nearest valid depth and the valid depth range is scaled like a color channel
+    // refineBandWidth > 0 (requires preLabels): only split within refineBandWidth pixels of pre-label boundaries,
+    // pre-label interiors stay fixed and band segments touching the interior are merged back into their pre-label,
+    // superpixels and returned label counts then refer to the merged labels (relabeled contiguously)
     int hhts(const InputArray image, const OutputArray outputLabels, const int superpixels, const double splitThreshold = 0.0, const int histogramBins = 16, const int minSegmentSize = 64, const int colorChannels = RGB | HSV | LAB,
-                    const bool applyBlur = false, const InputArray preLabels = noArray());
+                    const bool applyBlur = false, const InputArray preLabels = noArray(), const int refineBandWidth = 0, const InputArray depth = noArray());
 
     vector<int> hhts(const InputArray image, const OutputArrayOfArrays outputLabels,
                     const vector<int> &superpixels = {}, const double splitThreshold = 0.0, const int histogramBins = 16, const int minSegmentSize = 64, const int colorChannels = RGB | HSV | LAB,
-                    const bool applyBlur = false, const InputArray preLabels = noArray());
+                    const bool applyBlur = false, const InputArray preLabels = noArray(), const int refineBandWidth = 0, const InputArray depth = noArray());
 }
 
 #endif /* _HHTS_ */
@@ -91,10 +91,69 @@ void testAutotermination()
     }
 }
 
+void testBoundaryRefinement()
+{
+    string imagePath = "247012.jpg";
+    int spCount = 500;
+    int minDetailSize = 64;
+    int refineBandWidth = 8;
+
+    Mat image = imread(imagePath, IMREAD_COLOR);
+    Mat labels;
+
+    // synthetic pre-labels: ellipse in front of background
+    Mat preLabels = Mat::ones(image.size(), CV_32SC1);
+    ellipse(preLabels, Point(image.cols / 2, image.rows / 2), Size(image.cols / 4, image.rows / 3), 0, 0, 360, Scalar(2), FILLED);
+
+    boost::timer::cpu_timer timer;
+
+    int labelCount = HHTS::hhts(image, labels, spCount, 0.0, 32, minDetailSize, HHTS::ColorChannel::RGB | HHTS::ColorChannel::LAB | HHTS::ColorChannel::HSV, false, preLabels, refineBandWidth);
+
+    boost::chrono::duration<double> secondsWall = boost::chrono::nanoseconds(timer.elapsed().wall);
+    double elapsedWall = secondsWall.count();
+    cout << elapsedWall << endl;
+
+    imshow("mean labels " + to_string(labelCount), getColoredLabels(labels, image));
+    imshow("random labels " + to_string(labelCount), getColoredLabels(labels));
+}
+
+void testDepth16Bit()
+{
+    string imagePath = "247012.jpg";
+    int spCount = 500;
+    int minDetailSize = 64;
+
+    Mat image = imread(imagePath, IMREAD_COLOR);
+    Mat image16;
+    image.convertTo(image16, CV_16U, 257);
+    Mat labels;
+
+    // synthetic depth: ramp from 1000mm (top) to 5000mm (bottom) with an invalid hole
+    Mat depth(image.size(), CV_16UC1);
+    for (int y = 0; y < depth.rows; ++y)
+    {
+        depth.row(y).setTo(1000 + 4000 * y / depth.rows);
+    }
+    depth(Rect(depth.cols / 4, depth.rows / 4, depth.cols / 8, depth.rows / 8)).setTo(0);
+
+    boost::timer::cpu_timer timer;
+
+    int labelCount = HHTS::hhts(image16, labels, spCount, 0.0, 32, minDetailSize, HHTS::ColorChannel::RGB | HHTS::ColorChannel::LAB | HHTS::ColorChannel::HSV, false, noArray(), 0, depth);
+
+    boost::chrono::duration<double> secondsWall = boost::chrono::nanoseconds(timer.elapsed().wall);
+    double elapsedWall = secondsWall.count();
+    cout << elapsedWall << endl;
+
+    imshow("mean labels " + to_string(labelCount), getColoredLabels(labels, image));
+    imshow("random labels " + to_string(labelCount), getColoredLabels(labels));
+}
+
 int main(int argc, char *argv[])
 {
     testSingleLevel();
     // testMultiLevel();
     // testAutotermination();
+    // testBoundaryRefinement();
+    // testDepth16Bit();
     waitKey();
 }
\ No newline at end of file